@@ -2,26 +2,11 @@
 #include <ncurses.h>
 #include <stdio.h>
 #include <stdnoreturn.h>
-#define SELECT_TIMEOUT_USEC 100000
 #define BUFFER_SIZE 1024
-#define GAME_GRID_SIZE 20
 #define TEN 10
 
-typedef struct
-{
-    int                     socket;
-    int                     hostx;
-    int                     hosty;
-    int                     clientx;
-    int                     clienty;
-    bool                    is_host;
-    struct sockaddr_storage peer_addr;
-    socklen_t               peer_addr_len;
-    char                    game_state[BUFFER_SIZE];
-} Context;
-
-static Context               context;          // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
-static volatile sig_atomic_t quit_flag = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+Context               context;          // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+volatile sig_atomic_t quit_flag = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
 // Signal handler for graceful termination on SIGINT (Ctrl+C)
 void handle_signal(int signal)
@@ -139,12 +124,46 @@ void parse_arguments(int argc, char *argv[], const char **ip_address, char **por
 
     opterr = 0;
 
-    while((opt = getopt(argc, argv, "h")) != -1)
+    while((opt = getopt(argc, argv, "hlc:b:m:p:si:x:")) != -1)
     {
         switch(opt)
         {
             case 'h':
                 usage(argv[0], EXIT_SUCCESS, NULL);
+            case 'l':
+                context.low_latency.enabled = true;
+                break;
+            case 'c':
+                context.low_latency.enabled  = true;
+                context.low_latency.cpu_core = parse_int(argv[0], optarg, 0, CPU_SETSIZE - 1);
+                break;
+            case 'b':
+                context.low_latency.enabled      = true;
+                context.low_latency.rcvbuf_bytes = parse_int(argv[0], optarg, LOW_LATENCY_RCVBUF_MIN, LOW_LATENCY_RCVBUF_MAX);
+                break;
+            case 'm':
+                context.spectators.publish = true;
+                parseMulticastGroup(argv[0], optarg, &context.spectators.group_addr.sin_addr);
+                break;
+            case 'p':
+                context.spectators.group_addr.sin_port = htons(parse_in_port_t(argv[0], optarg));
+                break;
+            case 's':
+                context.spectators.watch = true;
+                break;
+            case 'x':
+                if(strlen(optarg) > METRICS_NAME_MAX || strchr(optarg, '/') != NULL)
+                {
+                    usage(argv[0], EXIT_FAILURE, "Metrics name must be a short name without '/'.");
+                }
+                context.metrics_name = optarg;
+                break;
+            case 'i':
+                if(inet_pton(AF_INET, optarg, &context.spectators.interface) != 1)
+                {
+                    usage(argv[0], EXIT_FAILURE, "Interface must be a local IPv4 address.");
+                }
+                break;
             case '?':
                 usage(argv[0], EXIT_FAILURE, "Unknown option.");
             default:
@@ -154,6 +173,16 @@ void parse_arguments(int argc, char *argv[], const char **ip_address, char **por
 
     remaining_args = argc - optind;
 
+    if(context.spectators.watch && (remaining_args != 2 || context.spectators.publish))
+    {
+        usage(argv[0], EXIT_FAILURE, "A spectator takes a multicast group and port.");
+    }
+
+    if(context.spectators.publish && remaining_args != 1)
+    {
+        usage(argv[0], EXIT_FAILURE, "Only the host can publish to spectators.");
+    }
+
     if(remaining_args == 1)
     {
         // Only a port is provided
@@ -219,6 +248,27 @@ in_port_t parse_in_port_t(const char *binary_name, const char *str)
     return (in_port_t)parsed_value;
 }
 
+// Parses a decimal integer option and checks it lies within [min, max]
+int parse_int(const char *binary_name, const char *str, int min, int max)
+{
+    char *endptr;
+    long  parsed_value;
+
+    errno        = 0;
+    parsed_value = strtol(str, &endptr, BASE_TEN);
+    if(errno != 0 || endptr == str || *endptr != '\0')
+    {
+        usage(binary_name, EXIT_FAILURE, "Invalid number in option.");
+    }
+
+    if(parsed_value < min || parsed_value > max)
+    {
+        usage(binary_name, EXIT_FAILURE, "Option value out of range.");
+    }
+
+    return (int)parsed_value;
+}
+
 // Converts an IP address (IPv4/IPv6) string into a sockaddr_storage structure
 // Translates a given IP address to a network address structure for later socket communication
 void convert_address(const char *address, struct sockaddr_storage *addr)
@@ -346,13 +396,25 @@ ssize_t receiveUDPMessage(int sockfd, struct sockaddr_storage *source_addr, sock
 
     if(bytes_received == -1)
     {
-        perror("recvfrom");
+        // A non-blocking socket with nothing queued is not an error
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            perror("recvfrom");
+        }
         return -1;    // Return an error instead of exiting the program
     }
 
+    if(context.low_latency.enabled)
+    {
+        recordWakeupLatency(sockfd);
+    }
+
     // Null-terminate the received data
     buffer[bytes_received] = '\0';
 
+    metricAdd(&context.metrics->packets_in, 1);
+    metricAdd(&context.metrics->bytes_received, (uint64_t)bytes_received);
+
     // For the host, store the client's address after receiving the first message
     if(context.is_host && context.peer_addr_len == 0 && addr_len != NULL && source_addr != NULL)
     {
@@ -360,6 +422,15 @@ ssize_t receiveUDPMessage(int sockfd, struct sockaddr_storage *source_addr, sock
         context.peer_addr_len = *addr_len;
     }
 
+    // One peer per game: anyone else must neither keep the session alive nor move a dot
+    if(context.peer_addr_len > 0 && source_addr != NULL && !sameAddress(source_addr, &context.peer_addr))
+    {
+        metricAdd(&context.metrics->foreign_packets, 1);
+        return 0;
+    }
+
+    sessionActivity();
+
     // Process the received message
     handleReceivedPacket(buffer);
 
@@ -368,6 +439,33 @@ ssize_t receiveUDPMessage(int sockfd, struct sockaddr_storage *source_addr, sock
 
 #pragma GCC diagnostic pop
 
+// Compares family, address and port; the rest of the storage is padding
+bool sameAddress(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    if(a->ss_family != b->ss_family)
+    {
+        return false;
+    }
+
+    if(a->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+        const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+
+    if(a->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+
+        return a6->sin6_port == b6->sin6_port && memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+    }
+
+    return false;
+}
+
 char *createPacket(int x, int y, const char *game_state)
 {
     static char packet[BUFFER_SIZE];
@@ -391,6 +489,7 @@ void updateRemoteDot(const char *packet)
     int         x;
     int         y;
     char        game_state[BUFFER_SIZE];
+    bool        ack_only;
 
     packet_copy = strdup(packet);
     if(packet_copy == NULL)
@@ -404,6 +503,7 @@ void updateRemoteDot(const char *packet)
     if(token == NULL)
     {
         fprintf(stderr, "Invalid packet format: %s\n", packet);
+        metricAdd(&context.metrics->decode_errors, 1);
         free(packet_copy);
         return;
     }
@@ -412,6 +512,7 @@ void updateRemoteDot(const char *packet)
     if(*endptr != '\0')
     {
         fprintf(stderr, "Invalid X coordinate: %s\n", token);
+        metricAdd(&context.metrics->decode_errors, 1);
         free(packet_copy);
         return;
     }
@@ -421,6 +522,7 @@ void updateRemoteDot(const char *packet)
     if(token == NULL)
     {
         fprintf(stderr, "Invalid packet format: %s\n", packet);
+        metricAdd(&context.metrics->decode_errors, 1);
         free(packet_copy);
         return;
     }
@@ -429,6 +531,7 @@ void updateRemoteDot(const char *packet)
     if(*endptr != '\0')
     {
         fprintf(stderr, "Invalid Y coordinate: %s\n", token);
+        metricAdd(&context.metrics->decode_errors, 1);
         free(packet_copy);
         return;
     }
@@ -438,6 +541,7 @@ void updateRemoteDot(const char *packet)
     if(token == NULL)
     {
         fprintf(stderr, "Invalid packet format: %s\n", packet);
+        metricAdd(&context.metrics->decode_errors, 1);
         free(packet_copy);
         return;
     }
@@ -445,6 +549,16 @@ void updateRemoteDot(const char *packet)
     strncpy(game_state, token, sizeof(game_state) - 1);
     game_state[sizeof(game_state) - 1] = '\0';
 
+    // A bare ack is never acked or answered, so acks cannot bounce back and forth
+    ack_only = strcmp(game_state, ACK_ONLY_STATE) == 0;
+
+    // Optional fourth token: sequence and ack data
+    token = strtok_r(NULL, "|", &save_ptr);
+    if(token != NULL)
+    {
+        processLinkHeader(token, !ack_only);
+    }
+
     x = (int)x_long;
     y = (int)y_long;
 
@@ -455,7 +569,10 @@ void updateRemoteDot(const char *packet)
         context.clienty = y;
 
         // After receiving the client's position, send our position back
-        sendPositionUpdate();
+        if(!ack_only)
+        {
+            sendPositionUpdate();
+        }
     }
     else
     {
@@ -467,280 +584,1521 @@ void updateRemoteDot(const char *packet)
     free(packet_copy);
 }
 
-// Utility function
-_Noreturn void usage(const char *program_name, int exit_code, const char *message)
+// Returns microseconds from the monotonic clock, unaffected by wall-clock changes
+uint64_t monotonicUs(void)
 {
-    if(message)
+    struct timespec ts;
+
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
     {
-        fprintf(stderr, "%s\n", message);
+        perror("clock_gettime");
+        exit(EXIT_FAILURE);
     }
-    fprintf(stderr, "Usage: %s [-h] <IP address> <port>\n", program_name);
-    fprintf(stderr, "Options:\n  -h  Display this help message\n");
-    exit(exit_code);
+
+    return (uint64_t)ts.tv_sec * US_PER_SEC + (uint64_t)ts.tv_nsec / NS_PER_US;
 }
 
-// Function to generate random coordinates
-//void generateRandomCoordinates(int *x, int *y)
-//{
-//    *x = arc4random() % GAME_GRID_SIZE;    // Random x between 0 and 99
-//    *y = arc4random() % GAME_GRID_SIZE;    // Random y between 0 and 99
-//}
+// Returns milliseconds from the same clock
+uint64_t monotonicMs(void)
+{
+    return monotonicUs() / US_PER_MS;
+}
 
-// Set starting positions for both players
-void setStartingPositions(void)
+// Empties every slot of the wheel and anchors tick zero at now_ms
+void timerWheelInit(TimerWheel *wheel, uint64_t now_ms)
 {
-    if(context.is_host)
-    {
-        context.hostx   = GAME_GRID_SIZE / 2;
-        context.hosty   = GAME_GRID_SIZE / 2;
-        context.clientx = -1;    // Unknown position
-        context.clienty = -1;
-    }
-    else
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; ++level)
     {
-        context.clientx = GAME_GRID_SIZE / 2;
-        context.clienty = GAME_GRID_SIZE / 2;
-        context.hostx   = -1;    // Unknown position
-        context.hosty   = -1;
+        for(int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot)
+        {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
     }
-}
 
-// Clean up ncurses
-void cleanupNcurses(void)
-{
-    endwin();    // End ncurses mode
+    wheel->current   = 0;
+    wheel->origin_ms = now_ms;
 }
 
-// Draws the dots as X's
-void drawDot(int x, int y, int color_pair)
+void timerInit(Timer *timer, TimerCallback callback, void *arg)
 {
-    attron(COLOR_PAIR(color_pair));
-    mvaddch(y % LINES, x % COLS, 'X');
-    attroff(COLOR_PAIR(color_pair));
+    timer->next     = NULL;
+    timer->prev     = NULL;
+    timer->expires  = 0;
+    timer->callback = callback;
+    timer->arg      = arg;
 }
 
-// Read user input
-int getUserInput(void)
+bool timerPending(const Timer *timer)
 {
-    return getch();    // Non-blocking input
+    return timer->next != NULL;
 }
 
-// Update local dot based on input
-void updateLocalDot(int ch)
+// Links a timer into the slot matching its expiry
+// Level n holds timers due within 64^(n+1) ticks, indexed by bits [6n, 6n+6) of the expiry
+static void timerWheelInsert(TimerWheel *wheel, Timer *timer)
 {
-    int *x;
-    int *y;
-    if(context.is_host)
+    const uint64_t max_delta = ((uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    uint64_t       delta;
+    int            level;
+    Timer         *head;
+
+    if(timer->expires < wheel->current)
     {
-        x = &context.hostx;
-        y = &context.hosty;
+        // Already overdue: run on the next tick processed
+        timer->expires = wheel->current;
     }
-    else
+
+    delta = timer->expires - wheel->current;
+    if(delta > max_delta)
     {
-        x = &context.clientx;
-        y = &context.clienty;
+        timer->expires = wheel->current + max_delta;
+        delta          = max_delta;
     }
 
-    switch(ch)
+    level = 0;
+    while(level < TIMER_WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * (level + 1))))
     {
-        case KEY_UP:
-            *y = (*y - 1 + GAME_GRID_SIZE) % GAME_GRID_SIZE;
-            break;
-        case KEY_DOWN:
-            *y = (*y + 1) % GAME_GRID_SIZE;
-            break;
-        case KEY_LEFT:
-            *x = (*x - 1 + GAME_GRID_SIZE) % GAME_GRID_SIZE;
-            break;
-        case KEY_RIGHT:
-            *x = (*x + 1) % GAME_GRID_SIZE;
-            break;
-        default:
-            break;
+        ++level;
     }
+
+    head             = &wheel->slots[level][(timer->expires >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK];
+    timer->next      = head;
+    timer->prev      = head->prev;
+    head->prev->next = timer;
+    head->prev       = timer;
 }
 
-// Clear the screen
-void clearScreen(void)
+// Arms (or re-arms) a timer to fire delay_ms from now_ms
+void timerWheelSchedule(TimerWheel *wheel, Timer *timer, uint64_t now_ms, uint64_t delay_ms)
 {
-    clear();
-    refresh();
+    uint64_t elapsed_ms;
+
+    timerWheelCancel(timer);
+
+    elapsed_ms     = now_ms > wheel->origin_ms ? now_ms - wheel->origin_ms : 0;
+    timer->expires = (elapsed_ms + delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timerWheelInsert(wheel, timer);
 }
 
-// Sends update of dot position
-void sendPositionUpdate(void)
+// Unlinks a pending timer; cancelling an idle timer is a no-op
+void timerWheelCancel(Timer *timer)
 {
-    int         x;
-    int         y;
-    const char *packet;
-    if(context.is_host)
+    if(!timerPending(timer))
     {
-        x = context.hostx;
-        y = context.hosty;
+        return;
     }
-    else
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next       = NULL;
+    timer->prev       = NULL;
+}
+
+// Redistributes one higher-level slot into the levels below it
+// Returns the slot index so the caller knows whether to cascade further up
+static uint64_t timerWheelCascade(TimerWheel *wheel, int level)
+{
+    uint64_t index;
+    Timer   *head;
+
+    index = (wheel->current >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+    head  = &wheel->slots[level][index];
+
+    while(head->next != head)
     {
-        x = context.clientx;
-        y = context.clienty;
+        Timer *timer = head->next;
+
+        timerWheelCancel(timer);
+        timerWheelInsert(wheel, timer);
     }
-    packet = createPacket(x, y, "update");
 
-    // Only send if we have a valid peer address
-    if(context.peer_addr_len > 0)
+    return index;
+}
+
+// Processes every tick up to now_ms, firing expired timers
+// Callbacks may schedule or cancel any timer, including the one that fired
+void timerWheelAdvance(TimerWheel *wheel, uint64_t now_ms)
+{
+    uint64_t target;
+
+    if(now_ms < wheel->origin_ms)
+    {
+        return;
+    }
+
+    target = (now_ms - wheel->origin_ms) / TIMER_TICK_MS;
+
+    while(wheel->current <= target)
     {
-        if(sendto(context.socket, packet, strlen(packet), 0, (struct sockaddr *)&context.peer_addr, context.peer_addr_len) == -1)
+        Timer *head;
+        Timer  expired;
+
+        if((wheel->current & TIMER_WHEEL_SLOT_MASK) == 0)
         {
-            perror("Failed to send message");
-            // Handle error appropriately, possibly exit or set a flag
+            for(int level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+            {
+                if(timerWheelCascade(wheel, level) != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        // Detach the due slot first so re-armed timers land in a fresh list
+        head = &wheel->slots[0][wheel->current & TIMER_WHEEL_SLOT_MASK];
+        wheel->current++;
+        if(head->next == head)
+        {
+            continue;
+        }
+
+        expired.next       = head->next;
+        expired.prev       = head->prev;
+        expired.next->prev = &expired;
+        expired.prev->next = &expired;
+        head->next         = head;
+        head->prev         = head;
+
+        while(expired.next != &expired)
+        {
+            Timer *timer = expired.next;
+
+            timerWheelCancel(timer);
+            timer->callback(timer, timer->arg);
         }
     }
 }
 
-void updateScreen(void)
+// Milliseconds until the wheel next needs servicing
+// Scans level 0 up to the next cascade boundary only, so the cost is bounded by the slot count.
+// A boundary tick, including the current one, may pull timers down from higher levels, so the scan stops there.
+uint64_t timerWheelNextTimeoutMs(const TimerWheel *wheel, uint64_t now_ms)
 {
-    clear();    // Clear the screen
+    uint64_t ticks;
+    uint64_t deadline_ms;
 
-    // Draw the grid background
-    for(int y = 0; y < GAME_GRID_SIZE; ++y)
+    for(ticks = 0; ticks < TIMER_WHEEL_SLOTS; ++ticks)
     {
-        for(int x = 0; x < GAME_GRID_SIZE; ++x)
+        const Timer *head = &wheel->slots[0][(wheel->current + ticks) & TIMER_WHEEL_SLOT_MASK];
+
+        if(((wheel->current + ticks) & TIMER_WHEEL_SLOT_MASK) == 0 || head->next != head)
         {
-            mvaddch(y, x, '.');    // Move to position (y, x) and add a dot
+            break;
         }
     }
 
-    // Draw local player's dot
-    if(context.is_host)
+    deadline_ms = wheel->origin_ms + (wheel->current + ticks) * TIMER_TICK_MS;
+    return deadline_ms > now_ms ? deadline_ms - now_ms : 0;
+}
+
+// Puts the socket and process into low-latency mode
+// Each step is best effort: a missing privilege is reported and the rest still applies
+void enableLowLatency(int sockfd)
+{
+    int       flags;
+    int       rcvbuf;
+    socklen_t optlen;
+
+    flags = fcntl(sockfd, F_GETFL, 0);
+    if(flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1)
     {
-        drawDot(context.hostx, context.hosty, 1);    // Host dot
+        perror("fcntl O_NONBLOCK");
+        exit(EXIT_FAILURE);
     }
-    else
+
+#ifdef SO_BUSY_POLL
+    {
+        int busy_poll = BUSY_POLL_USEC;
+
+        // Values above net.core.busy_read need CAP_NET_ADMIN
+        if(setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) == -1)
+        {
+            perror("setsockopt SO_BUSY_POLL");
+        }
+    }
+#endif
+
+    // A small buffer keeps stale updates from queueing behind fresh ones
+    if(setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &context.low_latency.rcvbuf_bytes, sizeof(context.low_latency.rcvbuf_bytes)) == -1)
+    {
+        perror("setsockopt SO_RCVBUF");
+    }
+
+    optlen = sizeof(rcvbuf);
+    if(getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) == 0)
     {
-        drawDot(context.clientx, context.clienty, 2);    // Client dot
+        // The kernel may double or clamp the request; remember what we actually got
+        context.low_latency.rcvbuf_bytes = rcvbuf;
     }
 
-    // Draw remote player's dot if known
-    if(context.is_host && context.clientx >= 0 && context.clienty >= 0)
+#ifdef __linux__
+    if(context.low_latency.cpu_core >= 0)
     {
-        drawDot(context.clientx, context.clienty, 2);    // Client dot
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET((size_t)context.low_latency.cpu_core, &cpus);
+        if(sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+        {
+            perror("sched_setaffinity");
+        }
     }
-    else if(!context.is_host && context.hostx >= 0 && context.hosty >= 0)
+#endif
+
+    if(setpriority(PRIO_PROCESS, 0, LOW_LATENCY_NICE) == -1)
     {
-        drawDot(context.hostx, context.hosty, 1);    // Host dot
+        perror("setpriority");
     }
 
-    refresh();    // Refresh the screen to display changes
+    context.low_latency.start_us = monotonicUs();
+    getrusage(RUSAGE_SELF, &context.low_latency.start_usage);
 }
 
-// Receives updates of dot position
-void receivePositionUpdate(void)
+// Samples how long the last datagram waited between kernel arrival and user space
+void recordWakeupLatency(int sockfd)
 {
-    char                    buffer[BUFFER_SIZE];
-    struct sockaddr_storage source_addr;
-    socklen_t               addr_len = sizeof(source_addr);
+#ifdef SIOCGSTAMPNS
+    struct timespec arrived;
+    struct timespec now;
+    int64_t         latency_ns;
 
-    ssize_t bytes = receiveUDPMessage(context.socket, &source_addr, &addr_len, buffer, sizeof(buffer));
-    if(bytes > 0)
+    // The first call turns on timestamping, so the first packet has no sample
+    if(ioctl(sockfd, SIOCGSTAMPNS, &arrived) == -1 || clock_gettime(CLOCK_REALTIME, &now) == -1)
     {
-        updateRemoteDot(buffer);
-        updateScreen();
+        return;
     }
-}
 
-// Update the screen to show both local and remote dots
-void handleInput(void)
-{
-    int ch = getch();
-    if(ch != ERR)
+    latency_ns = (int64_t)(now.tv_sec - arrived.tv_sec) * 1000000000 + (now.tv_nsec - arrived.tv_nsec);
+    if(latency_ns < 0)
     {
-        updateLocalDot(ch);
-        sendPositionUpdate();
-        updateScreen();
+        return;
     }
-}
 
-// Display an error message and exit
-_Noreturn void errorMessage(const char *msg)
-{
-    cleanupNcurses();
-    fprintf(stderr, "Error: %s\n", msg);
-    exit(EXIT_FAILURE);
+    context.low_latency.samples++;
+    context.low_latency.latency_sum_ns += (uint64_t)latency_ns;
+    if((uint64_t)latency_ns > context.low_latency.latency_max_ns)
+    {
+        context.low_latency.latency_max_ns = (uint64_t)latency_ns;
+    }
+#else
+    (void)sockfd;
+#endif
 }
 
-// Main entry point of the program
-// Parses the command-line arguments, initializes the socket and game loop
-// Handles communication between host and client based on the mode (host or client)
-int main(int argc, char *argv[])
+// Spins on the non-blocking socket and keyboard instead of sleeping in select()
+void busyPollLoop(int sockfd)
 {
     struct sockaddr_storage addr;
-    socklen_t               addr_len = sizeof(addr);
-    int                     sockfd;
+    socklen_t               addr_len;
     char                    buffer[BUFFER_SIZE];
-    const char             *ip_address = NULL;
-    char                   *port       = NULL;
 
-    uint32_t randomSeed = arc4random();
-    srand(randomSeed);
+    while(!quit_flag)
+    {
+        ssize_t bytes;
 
-    memset(&context, 0, sizeof(Context));
-    setupNcurses();
+        addr_len = sizeof(addr);
+        bytes    = receiveUDPMessage(sockfd, &addr, &addr_len, buffer, sizeof(buffer));
+        context.low_latency.polls++;
+        if(bytes > 0)
+        {
+            // receiveUDPMessage has already applied the update
+            updateScreen();
+        }
 
-    parse_arguments(argc, argv, &ip_address, &port);
+        handleInput();
+        timerWheelAdvance(&context.timers, monotonicMs());
+    }
+}
 
-    sockfd         = socket_create(AF_INET, SOCK_DGRAM, 0);
-    context.socket = sockfd;
+// Prints the CPU cost and wakeup latency observed while busy-polling
+void reportLowLatency(void)
+{
+    struct rusage usage;
+    uint64_t      wall_us;
+    uint64_t      cpu_us;
 
-    setupConnection(&sockfd, &addr, ip_address, port);
+    if(getrusage(RUSAGE_SELF, &usage) == -1)
+    {
+        perror("getrusage");
+        return;
+    }
 
-    setStartingPositions();
-    sendPositionUpdate();
-    updateScreen();
+    wall_us = monotonicUs() - context.low_latency.start_us;
+    cpu_us  = (uint64_t)((usage.ru_utime.tv_sec - context.low_latency.start_usage.ru_utime.tv_sec) + (usage.ru_stime.tv_sec - context.low_latency.start_usage.ru_stime.tv_sec)) * US_PER_SEC;
+    cpu_us += (uint64_t)((usage.ru_utime.tv_usec - context.low_latency.start_usage.ru_utime.tv_usec) + (usage.ru_stime.tv_usec - context.low_latency.start_usage.ru_stime.tv_usec));
 
-    signal(SIGINT, handle_signal);
+    printf("Low-latency mode: %.1f%% CPU over %.1f s, %" PRIu64 " polls, receive buffer %d bytes\n",
+           wall_us > 0 ? 100.0 * (double)cpu_us / (double)wall_us : 0.0,
+           (double)wall_us / 1e6,
+           context.low_latency.polls,
+           context.low_latency.rcvbuf_bytes);
 
-    while(!quit_flag)
+    if(context.low_latency.samples > 0)
     {
-        int            activity;
-        int            max_fd;
-        fd_set         readfds;
-        struct timeval tv;
-
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        FD_SET(STDIN_FILENO, &readfds);
+        printf("Wakeup latency over %" PRIu64 " packets: avg %.1f us, max %.1f us\n",
+               context.low_latency.samples,
+               (double)context.low_latency.latency_sum_ns / (double)context.low_latency.samples / 1e3,
+               (double)context.low_latency.latency_max_ns / 1e3);
+    }
+}
 
-        tv.tv_sec  = 0;
-        tv.tv_usec = SELECT_TIMEOUT_USEC;
+// Forgets everything queued for the client, ready for a new one
+void resetClientUpdates(void)
+{
+    memset(&context.updates, 0, sizeof(context.updates));
+}
 
-        max_fd   = sockfd > STDIN_FILENO ? sockfd : STDIN_FILENO;
-        activity = select(max_fd + 1, &readfds, NULL, NULL, &tv);
+// Marks an entity as changed; it goes out on a later tick, most relevant first
+void queueEntityUpdate(int entity)
+{
+    context.updates.pending[entity] = true;
+}
+
+// True while any entity is waiting for the scheduler
+bool updatesPending(void)
+{
+    for(int entity = 0; entity < MAX_ENTITIES; ++entity)
+    {
+        if(context.updates.pending[entity])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void entityPosition(int entity, int *x, int *y)
+{
+    if(entity == ENTITY_HOST)
+    {
+        *x = context.hostx;
+        *y = context.hosty;
+    }
+    else
+    {
+        *x = context.clientx;
+        *y = context.clienty;
+    }
+}
+
+// Manhattan distance on the wrapping grid between an entity and the client's player
+int entityDistanceToClient(int entity)
+{
+    int x;
+    int y;
+    int dx;
+    int dy;
+
+    entityPosition(entity, &x, &y);
+    if(x < 0 || y < 0 || context.clientx < 0 || context.clienty < 0)
+    {
+        // Unknown positions rank as far away
+        return GAME_GRID_SIZE;
+    }
+
+    dx = abs(x - context.clientx);
+    dy = abs(y - context.clienty);
+    dx = dx < GAME_GRID_SIZE - dx ? dx : GAME_GRID_SIZE - dx;
+    dy = dy < GAME_GRID_SIZE - dy ? dy : GAME_GRID_SIZE - dy;
+
+    return dx + dy;
+}
+
+// Runs once per simulation tick on the host
+// Accumulates priority for every pending entity, then spends the client's byte budget highest priority first.
+// Whatever does not fit keeps its priority and so moves up the queue for the next tick.
+void scheduleUpdates(void)
+{
+    ClientUpdates *client = &context.updates;
+    int            order[MAX_ENTITIES];
+    int            count = 0;
+
+    if(!context.is_host || context.peer_addr_len == 0)
+    {
+        return;
+    }
+
+    for(int entity = 0; entity < MAX_ENTITIES; ++entity)
+    {
+        int slot;
+
+        // The client owns its own dot and never needs it echoed back
+        if(!client->pending[entity] || entity == ENTITY_CLIENT)
+        {
+            continue;
+        }
+
+        client->priority[entity] += PRIORITY_SCALE / (uint32_t)(1 + entityDistanceToClient(entity));
+
+        // Insertion sort, highest priority first
+        for(slot = count; slot > 0 && client->priority[order[slot - 1]] < client->priority[entity]; --slot)
+        {
+            order[slot] = order[slot - 1];
+        }
+        order[slot] = entity;
+        ++count;
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        const char *packet;
+        int         x;
+        int         y;
+
+        entityPosition(order[i], &x, &y);
+        packet = createPacket(x, y, "update");
+        if(packetWireSize(packet) > context.link.budget_bytes)
+        {
+            continue;
+        }
+
+        // sendPacketToPeer charges the budget
+        sendPacketToPeer(packet, true);
+        client->priority[order[i]] = 0;
+        client->pending[order[i]]  = false;
+    }
+}
+
+// Starts sequence numbering, RTT estimation and the send rate afresh
+void resetPeerLink(void)
+{
+    memset(&context.link, 0, sizeof(context.link));
+    context.link.rate_bytes_per_sec = RATE_INITIAL_BYTES_PER_SEC;
+    context.link.budget_bytes       = CLIENT_BURST_BYTES;
+}
+
+// Sequence comparison that survives wrap-around
+bool seqGreater(uint16_t a, uint16_t b)
+{
+    return a != b && (uint16_t)(a - b) < SEQ_HALF_RANGE;
+}
+
+// Handles "seq[,ack,ack_bits[,hold_us]]" from the peer: records what they sent and what they have seen of ours
+// hold_us is how long the peer sat on the newest ack before sending it, which is not network time
+void processLinkHeader(const char *header, bool wants_ack)
+{
+    PeerLink     *link = &context.link;
+    char         *endptr;
+    unsigned long seq;
+    unsigned long ack;
+    unsigned long bits;
+    unsigned long hold_us = 0;
+    uint64_t      now_us;
+
+    seq = strtoul(header, &endptr, BASE_TEN);
+    if(endptr == header || seq > UINT16_MAX)
+    {
+        fprintf(stderr, "Invalid link header: %s\n", header);
+        metricAdd(&context.metrics->decode_errors, 1);
+        return;
+    }
+
+    now_us = monotonicUs();
+
+    // Remember the peer's sequence number so our next packet acks it
+    if(!link->have_remote)
+    {
+        link->remote_seq     = (uint16_t)seq;
+        link->remote_bits    = 0;
+        link->have_remote    = true;
+        link->remote_recv_us = now_us;
+    }
+    else if(seqGreater((uint16_t)seq, link->remote_seq))
+    {
+        uint16_t shift = (uint16_t)((uint16_t)seq - link->remote_seq);
+
+        if(shift < ACK_BITS)
+        {
+            link->remote_bits = (link->remote_bits << shift) | (1U << (shift - 1));
+        }
+        else
+        {
+            link->remote_bits = shift == ACK_BITS ? 1U << (ACK_BITS - 1) : 0;
+        }
+        link->remote_seq     = (uint16_t)seq;
+        link->remote_recv_us = now_us;
+    }
+    else
+    {
+        uint16_t behind = (uint16_t)(link->remote_seq - (uint16_t)seq);
+
+        if(behind > LINK_REORDER_WINDOW || (behind > 0 && now_us - link->remote_recv_us >= (uint64_t)LINK_STALE_MS * US_PER_MS))
+        {
+            // Too far back or too late to be reordering: the peer restarted and numbers from scratch
+            link->remote_seq     = (uint16_t)seq;
+            link->remote_bits    = 0;
+            link->remote_recv_us = now_us;
+        }
+        else if(behind >= 1 && behind <= ACK_BITS)
+        {
+            link->remote_bits |= 1U << (behind - 1);
+        }
+    }
+
+    if(wants_ack && !timerPending(&context.ack_timer))
+    {
+        timerWheelSchedule(&context.timers, &context.ack_timer, monotonicMs(), ACK_DELAY_MS);
+    }
+
+    if(*endptr != ',')
+    {
+        // Peer has not heard from us yet, so there is nothing to ack
+        return;
+    }
+
+    header = endptr + 1;
+    ack    = strtoul(header, &endptr, BASE_TEN);
+    if(endptr == header || *endptr != ',' || ack > UINT16_MAX)
+    {
+        fprintf(stderr, "Invalid link header ack\n");
+        metricAdd(&context.metrics->decode_errors, 1);
+        return;
+    }
+
+    header = endptr + 1;
+    bits   = strtoul(header, &endptr, BASE_TEN);
+    if(endptr == header || (*endptr != '\0' && *endptr != ',') || bits > UINT32_MAX)
+    {
+        fprintf(stderr, "Invalid link header ack bits\n");
+        metricAdd(&context.metrics->decode_errors, 1);
+        return;
+    }
+
+    if(*endptr == ',')
+    {
+        header  = endptr + 1;
+        hold_us = strtoul(header, &endptr, BASE_TEN);
+        if(endptr == header || *endptr != '\0' || hold_us > UINT32_MAX)
+        {
+            fprintf(stderr, "Invalid link header hold time\n");
+            metricAdd(&context.metrics->decode_errors, 1);
+            return;
+        }
+    }
+
+    // Only the newest ack comes with a known hold time, so only it yields an RTT sample
+    ackSentPacket((uint16_t)ack, now_us, true, hold_us);
+    for(uint16_t n = 0; n < ACK_BITS; ++n)
+    {
+        if(bits & (1UL << n))
+        {
+            ackSentPacket((uint16_t)(ack - 1 - n), now_us, false, 0);
+        }
+    }
+
+    if(!link->have_ack || seqGreater((uint16_t)ack, link->latest_ack))
+    {
+        link->latest_ack = (uint16_t)ack;
+        link->have_ack   = true;
+    }
+
+    // Anything still in flight well behind the newest ack is not coming back
+    for(int i = 0; i < SENT_HISTORY; ++i)
+    {
+        SentPacket *record = &link->sent[i];
+
+        if(record->in_flight && seqGreater((uint16_t)(link->latest_ack - LOSS_REORDER_THRESHOLD), record->seq))
+        {
+            record->in_flight = false;
+            link->lost++;
+        }
+    }
+}
+
+// Marks one of our packets as delivered and, when asked, feeds its round trip less the peer's hold time into the RTT estimate
+void ackSentPacket(uint16_t seq, uint64_t now_us, bool sample_rtt, uint64_t hold_us)
+{
+    SentPacket *record = &context.link.sent[seq % SENT_HISTORY];
+    uint64_t    rtt_us;
+
+    if(!record->in_flight || record->seq != seq)
+    {
+        // Already acked, declared lost, or overwritten
+        return;
+    }
+
+    record->in_flight = false;
+    context.link.acked++;
+
+    rtt_us = now_us - record->sent_us;
+    if(!sample_rtt || hold_us >= rtt_us)
+    {
+        return;
+    }
+
+    rtt_us -= hold_us;
+    if(context.link.srtt_us == 0)
+    {
+        context.link.srtt_us    = rtt_us;
+        context.link.min_rtt_us = rtt_us;
+    }
+    else
+    {
+        // Same 1/8 gain as TCP's smoothed RTT
+        context.link.srtt_us = (context.link.srtt_us * (SRTT_GAIN_DIVISOR - 1) + rtt_us) / SRTT_GAIN_DIVISOR;
+        if(rtt_us < context.link.min_rtt_us)
+        {
+            context.link.min_rtt_us = rtt_us;
+        }
+    }
+}
+
+// Tops up the token bucket at the current rate; called once per simulation tick
+void refillSendBudget(void)
+{
+    context.link.budget_bytes += context.link.rate_bytes_per_sec * SIM_TICK_MS / MS_PER_SEC;
+    if(context.link.budget_bytes > CLIENT_BURST_BYTES)
+    {
+        context.link.budget_bytes = CLIENT_BURST_BYTES;
+    }
+}
+
+// Nothing went out since the peer's last packet: send a bare ack so the peer's RTT and loss estimates keep moving
+// It bypasses the host's scheduler and is dropped if over budget; the next real packet carries the same acks
+void onAckDelay(Timer *timer, void *arg)
+{
+    const char *packet;
+    int         x;
+    int         y;
+
+    (void)timer;
+    (void)arg;
+
+    entityPosition(context.is_host ? ENTITY_HOST : ENTITY_CLIENT, &x, &y);
+    packet = createPacket(x, y, ACK_ONLY_STATE);
+    if(packetWireSize(packet) <= context.link.budget_bytes)
+    {
+        sendPacketToPeer(packet, false);
+    }
+}
+
+// AIMD: halve the rate on loss or a growing queue, otherwise probe upward
+void onRateControl(Timer *timer, void *arg)
+{
+    PeerLink *link = &context.link;
+    uint32_t  decided;
+    bool      congested;
+
+    (void)arg;
+
+    decided = link->acked + link->lost;
+    if(decided > 0)
+    {
+        congested = link->lost * PERCENT > decided * LOSS_THRESHOLD_PERCENT || link->srtt_us > link->min_rtt_us + RTT_INFLATION_US;
+
+        if(congested)
+        {
+            link->rate_bytes_per_sec /= 2;
+            if(link->rate_bytes_per_sec < RATE_FLOOR_BYTES_PER_SEC)
+            {
+                link->rate_bytes_per_sec = RATE_FLOOR_BYTES_PER_SEC;
+            }
+        }
+        else
+        {
+            link->rate_bytes_per_sec += RATE_INCREASE_BYTES_PER_SEC;
+            if(link->rate_bytes_per_sec > RATE_CEILING_BYTES_PER_SEC)
+            {
+                link->rate_bytes_per_sec = RATE_CEILING_BYTES_PER_SEC;
+            }
+        }
+
+        link->acked = 0;
+        link->lost  = 0;
+    }
+
+    metricSet(&context.metrics->send_rate_bytes_per_sec, link->rate_bytes_per_sec);
+    metricSet(&context.metrics->srtt_us, link->srtt_us);
+
+    timerWheelSchedule(&context.timers, timer, monotonicMs(), RATE_CONTROL_INTERVAL_MS);
+}
+
+// Parses an IPv4 multicast group address
+void parseMulticastGroup(const char *binary_name, const char *str, struct in_addr *group)
+{
+    if(inet_pton(AF_INET, str, group) != 1 || !IN_MULTICAST(ntohl(group->s_addr)))
+    {
+        usage(binary_name, EXIT_FAILURE, "Spectator group must be an IPv4 multicast address (224.0.0.0/4).");
+    }
+}
+
+// Opens the host's publishing socket; loopback is on so spectators on this machine see the feed too
+void setupSpectatorPublisher(void)
+{
+    unsigned char loop = 1;
+    unsigned char ttl  = SPECTATOR_TTL;
+
+    context.spectators.socket                = socket_create(AF_INET, SOCK_DGRAM, 0);
+    context.spectators.group_addr.sin_family = AF_INET;
+    if(context.spectators.group_addr.sin_port == 0)
+    {
+        context.spectators.group_addr.sin_port = htons(DEFAULT_SPECTATOR_PORT);
+    }
+
+    if(setsockopt(context.spectators.socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == -1)
+    {
+        perror("setsockopt IP_MULTICAST_LOOP");
+        exit(EXIT_FAILURE);
+    }
+
+    if(setsockopt(context.spectators.socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == -1)
+    {
+        perror("setsockopt IP_MULTICAST_TTL");
+        exit(EXIT_FAILURE);
+    }
+
+    if(context.spectators.interface.s_addr != htonl(INADDR_ANY) &&
+       setsockopt(context.spectators.socket, IPPROTO_IP, IP_MULTICAST_IF, &context.spectators.interface, sizeof(context.spectators.interface)) == -1)
+    {
+        perror("setsockopt IP_MULTICAST_IF");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Binds the spectator socket to the group's port and joins the group
+// SO_REUSEADDR lets several spectators on one machine share the port
+void joinSpectatorGroup(int sockfd, const char *group, const char *port)
+{
+    struct sockaddr_storage addr;
+    struct ip_mreq          membership;
+    int                     reuse = 1;
+
+    parseMulticastGroup("game", group, &membership.imr_multiaddr);
+    membership.imr_interface = context.spectators.interface;
+
+    if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1)
+    {
+        perror("setsockopt SO_REUSEADDR");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.ss_family = AF_INET;
+    socket_bind(sockfd, &addr, parse_in_port_t("game", port));
+
+    if(setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) == -1)
+    {
+        perror("setsockopt IP_ADD_MEMBERSHIP");
+        exit(EXIT_FAILURE);
+    }
+
+    context.hostx   = -1;
+    context.hosty   = -1;
+    context.clientx = -1;
+    context.clienty = -1;
+}
+
+// Full game state for spectators: "hostx,hosty,clientx,clienty|snapshot|seq"
+char *createSnapshot(uint16_t seq)
+{
+    static char snapshot[BUFFER_SIZE];
+    snprintf(snapshot, sizeof(snapshot), "%d,%d,%d,%d|snapshot|%u", context.hostx, context.hosty, context.clientx, context.clienty, seq);
+    return snapshot;
+}
+
+// Sends one snapshot to the group; the cost is the same for one spectator or a thousand
+void publishSnapshot(void)
+{
+    const char *snapshot;
+    ssize_t     sent;
+
+    snapshot = createSnapshot(context.spectators.snapshot_seq++);
+    sent     = sendto(context.spectators.socket, snapshot, strlen(snapshot), 0, (struct sockaddr *)&context.spectators.group_addr, sizeof(context.spectators.group_addr));
+    if(sent == -1)
+    {
+        perror("Failed to publish snapshot");
+        return;
+    }
+
+    metricAdd(&context.metrics->packets_out, 1);
+    metricAdd(&context.metrics->bytes_sent, (uint64_t)sent);
+}
+
+// Applies a snapshot, ignoring any that arrive slightly older than the one on screen
+// A large backwards jump or a long silence means the host restarted, so the sequence starts over
+void updateSpectatorView(const char *packet)
+{
+    int      hostx;
+    int      hosty;
+    int      clientx;
+    int      clienty;
+    unsigned seq;
+    uint64_t now_ms;
+
+    if(sscanf(packet, "%d,%d,%d,%d|snapshot|%u", &hostx, &hosty, &clientx, &clienty, &seq) != 5 || seq > UINT16_MAX)    // NOLINT(cert-err34-c)
+    {
+        fprintf(stderr, "Invalid snapshot: %s\n", packet);
+        metricAdd(&context.metrics->decode_errors, 1);
+        return;
+    }
+
+    now_ms = monotonicMs();
+    if(context.spectators.have_snapshot && !seqGreater((uint16_t)seq, context.spectators.snapshot_seq) &&
+       (uint16_t)(context.spectators.snapshot_seq - (uint16_t)seq) <= SPECTATOR_REORDER_WINDOW && now_ms - context.spectators.snapshot_ms < SPECTATOR_STALE_MS)
+    {
+        return;
+    }
+
+    context.spectators.snapshot_seq  = (uint16_t)seq;
+    context.spectators.have_snapshot = true;
+    context.spectators.snapshot_ms   = now_ms;
+    context.hostx                    = hostx;
+    context.hosty                    = hosty;
+    context.clientx                  = clientx;
+    context.clienty                  = clienty;
+}
+
+// Receive-only loop for spectators: nothing is ever sent back to the host
+void spectateLoop(int sockfd)
+{
+    char buffer[BUFFER_SIZE];
+
+    while(!quit_flag)
+    {
+        fd_set         readfds;
+        struct timeval tv;
+
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+
+        tv.tv_sec  = 0;
+        tv.tv_usec = SELECT_TIMEOUT_USEC;
+
+        if(select(sockfd + 1, &readfds, NULL, NULL, &tv) > 0 && FD_ISSET(sockfd, &readfds))
+        {
+            ssize_t bytes = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
+
+            if(bytes > 0)
+            {
+                buffer[bytes] = '\0';
+                updateSpectatorView(buffer);
+                updateScreen();
+            }
+        }
+    }
+}
+
+// Counters and gauges are written only by the game thread; relaxed atomics keep readers tear-free without locks
+void metricAdd(_Atomic uint64_t *metric, uint64_t amount)
+{
+    atomic_fetch_add_explicit(metric, amount, memory_order_relaxed);
+}
+
+void metricSet(_Atomic uint64_t *metric, uint64_t value)
+{
+    atomic_store_explicit(metric, value, memory_order_relaxed);
+}
+
+// Maps the shared metrics page and starts the scrape thread
+// With no name the counters live in a private page so the hot paths never need to check
+void initMetrics(const char *name)
+{
+    static Metrics local_metrics;
+    char           shm_name[METRICS_NAME_MAX + 2];
+    int            fd;
+    void          *page;
+    sigset_t       all_signals;
+    sigset_t       old_signals;
+    pthread_t      thread;
+
+    context.metrics = &local_metrics;
+    if(name == NULL)
+    {
+        return;
+    }
+
+    snprintf(shm_name, sizeof(shm_name), "/%s", name);
+    snprintf(context.metrics_socket_path, sizeof(context.metrics_socket_path), METRICS_SOCKET_FORMAT, name);
+
+    fd = shm_open(shm_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP);
+    if(fd == -1)
+    {
+        perror("shm_open");
+        exit(EXIT_FAILURE);
+    }
+
+    if(ftruncate(fd, sizeof(Metrics)) == -1)
+    {
+        perror("ftruncate");
+        exit(EXIT_FAILURE);
+    }
+
+    page = mmap(NULL, sizeof(Metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(page == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    context.metrics = (Metrics *)page;
+    memset(context.metrics, 0, sizeof(Metrics));
+    context.metrics->magic   = METRICS_MAGIC;
+    context.metrics->version = METRICS_VERSION;
+
+    // A scraper hanging up mid-write must not kill the game
+    signal(SIGPIPE, SIG_IGN);
+
+    // Keep signals on the game thread so SIGINT still wakes the main loop
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+    if(pthread_create(&thread, NULL, metricsServer, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to start metrics server\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    pthread_detach(thread);
+}
+
+// Renders the current values in the Prometheus text exposition format
+size_t formatMetrics(char *buffer, size_t size)
+{
+    const Metrics *m = context.metrics;
+    int            written;
+
+    written = snprintf(buffer,
+                       size,
+                       "# TYPE game_packets_in_total counter\n"
+                       "game_packets_in_total %" PRIu64 "\n"
+                       "# TYPE game_packets_out_total counter\n"
+                       "game_packets_out_total %" PRIu64 "\n"
+                       "# TYPE game_bytes_received_total counter\n"
+                       "game_bytes_received_total %" PRIu64 "\n"
+                       "# TYPE game_bytes_sent_total counter\n"
+                       "game_bytes_sent_total %" PRIu64 "\n"
+                       "# TYPE game_decode_errors_total counter\n"
+                       "game_decode_errors_total %" PRIu64 "\n"
+                       "# TYPE game_foreign_packets_total counter\n"
+                       "game_foreign_packets_total %" PRIu64 "\n"
+                       "# TYPE game_sessions gauge\n"
+                       "game_sessions %" PRIu64 "\n"
+                       "# TYPE game_tick_duration_seconds gauge\n"
+                       "game_tick_duration_seconds %.6f\n"
+                       "# TYPE game_render_seconds gauge\n"
+                       "game_render_seconds %.6f\n"
+                       "# TYPE game_send_rate_bytes_per_second gauge\n"
+                       "game_send_rate_bytes_per_second %" PRIu64 "\n"
+                       "# TYPE game_rtt_seconds gauge\n"
+                       "game_rtt_seconds %.6f\n",
+                       atomic_load_explicit(&m->packets_in, memory_order_relaxed),
+                       atomic_load_explicit(&m->packets_out, memory_order_relaxed),
+                       atomic_load_explicit(&m->bytes_received, memory_order_relaxed),
+                       atomic_load_explicit(&m->bytes_sent, memory_order_relaxed),
+                       atomic_load_explicit(&m->decode_errors, memory_order_relaxed),
+                       atomic_load_explicit(&m->foreign_packets, memory_order_relaxed),
+                       atomic_load_explicit(&m->sessions, memory_order_relaxed),
+                       (double)atomic_load_explicit(&m->tick_duration_us, memory_order_relaxed) / 1e6,
+                       (double)atomic_load_explicit(&m->render_time_us, memory_order_relaxed) / 1e6,
+                       atomic_load_explicit(&m->send_rate_bytes_per_sec, memory_order_relaxed),
+                       (double)atomic_load_explicit(&m->srtt_us, memory_order_relaxed) / 1e6);
+
+    if(written < 0)
+    {
+        return 0;
+    }
+
+    return (size_t)written < size ? (size_t)written : size - 1;
+}
+
+// Scrape thread: answers each connection on the Unix socket with one snapshot of the metrics
+// An HTTP GET gets an HTTP response (for Prometheus); anything else, or silence, gets plain text
+void *metricsServer(void *arg)
+{
+    struct sockaddr_un addr;
+    int                listener;
+
+    (void)arg;
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener == -1)
+    {
+        perror("metrics socket");
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, context.metrics_socket_path, sizeof(addr.sun_path) - 1);
+    unlink(addr.sun_path);
+
+    if(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listener, METRICS_BACKLOG) == -1)
+    {
+        perror("metrics bind");
+        close(listener);
+        return NULL;
+    }
+
+    for(;;)
+    {
+        char           request[BUFFER_SIZE];
+        char           body[METRICS_TEXT_SIZE];
+        char           header[BUFFER_SIZE];
+        struct timeval timeout;
+        ssize_t        received;
+        size_t         body_len;
+        int            conn;
+
+        conn = accept(listener, NULL, NULL);
+        if(conn == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("metrics accept");
+            break;
+        }
+
+        // Give the scraper a moment to send a request line, if it is going to
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = METRICS_REQUEST_TIMEOUT_USEC;
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        received = recv(conn, request, sizeof(request) - 1, 0);
+
+        body_len = formatMetrics(body, sizeof(body));
+        if(received > 0 && strncmp(request, "GET ", 4) == 0)
+        {
+            int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body_len);
+
+            if(write(conn, header, (size_t)header_len) == -1)
+            {
+                close(conn);
+                continue;
+            }
+        }
+
+        if(write(conn, body, body_len) == -1)
+        {
+            perror("metrics write");
+        }
+        close(conn);
+    }
+
+    close(listener);
+    return NULL;
+}
+
+// Removes the socket and shared page names; the mapping itself goes away with the process
+void closeMetrics(const char *name)
+{
+    char shm_name[METRICS_NAME_MAX + 2];
+
+    if(name == NULL)
+    {
+        return;
+    }
+
+    snprintf(shm_name, sizeof(shm_name), "/%s", name);
+    shm_unlink(shm_name);
+    unlink(context.metrics_socket_path);
+}
+
+// Arms the per-session timers and the simulation tick
+void startSessionTimers(void)
+{
+    uint64_t now = monotonicMs();
+
+    timerWheelInit(&context.timers, now);
+    timerInit(&context.idle_timer, onIdleTimeout, NULL);
+    timerInit(&context.keepalive_timer, onKeepalive, NULL);
+    timerInit(&context.retransmit_timer, onRetransmit, NULL);
+    timerInit(&context.tick_timer, simulationTick, NULL);
+    timerInit(&context.ack_timer, onAckDelay, NULL);
+    timerInit(&context.rate_timer, onRateControl, NULL);
+
+    timerWheelSchedule(&context.timers, &context.tick_timer, now, SIM_TICK_MS);
+    timerWheelSchedule(&context.timers, &context.rate_timer, now, RATE_CONTROL_INTERVAL_MS);
+    if(!context.is_host)
+    {
+        // Keep announcing ourselves until the host answers
+        timerWheelSchedule(&context.timers, &context.retransmit_timer, now, RETRANSMIT_INTERVAL_MS);
+    }
+}
 
-        if(activity > 0)
+// Called for every packet from the peer: pushes back the idle deadline
+void sessionActivity(void)
+{
+    context.peer_confirmed = true;
+    metricSet(&context.metrics->sessions, 1);
+    timerWheelCancel(&context.retransmit_timer);
+    timerWheelSchedule(&context.timers, &context.idle_timer, monotonicMs(), SESSION_IDLE_TIMEOUT_MS);
+}
+
+// The peer has been silent for SESSION_IDLE_TIMEOUT_MS
+void onIdleTimeout(Timer *timer, void *arg)
+{
+    (void)timer;
+    (void)arg;
+
+    context.peer_confirmed = false;
+    context.screen_dirty   = true;
+    metricSet(&context.metrics->sessions, 0);
+
+    if(context.is_host)
+    {
+        // Drop the client so a new one can take its place
+        context.peer_addr_len = 0;
+        context.clientx       = -1;
+        context.clienty       = -1;
+        timerWheelCancel(&context.keepalive_timer);
+        resetClientUpdates();
+        resetPeerLink();
+    }
+    else
+    {
+        // Host went away: hide its dot and start announcing again
+        context.hostx = -1;
+        context.hosty = -1;
+        resetPeerLink();
+        timerWheelSchedule(&context.timers, &context.retransmit_timer, monotonicMs(), RETRANSMIT_INTERVAL_MS);
+    }
+}
+
+void onKeepalive(Timer *timer, void *arg)
+{
+    (void)timer;
+    (void)arg;
+
+    sendPositionUpdate();
+}
+
+void onRetransmit(Timer *timer, void *arg)
+{
+    (void)arg;
+
+    sendPositionUpdate();
+    if(!context.peer_confirmed)
+    {
+        timerWheelSchedule(&context.timers, timer, monotonicMs(), RETRANSMIT_INTERVAL_MS);
+    }
+}
+
+// Fixed-rate simulation step; redraws when a timer changed the game state
+void simulationTick(Timer *timer, void *arg)
+{
+    uint64_t start_us = monotonicUs();
+
+    (void)arg;
+
+    refillSendBudget();
+    scheduleUpdates();
+    if(context.spectators.publish)
+    {
+        publishSnapshot();
+    }
+    if(context.link.send_pending)
+    {
+        sendPositionUpdate();
+    }
+
+    if(context.screen_dirty)
+    {
+        updateScreen();
+    }
+
+    metricSet(&context.metrics->tick_duration_us, monotonicUs() - start_us);
+    timerWheelSchedule(&context.timers, timer, monotonicMs(), SIM_TICK_MS);
+}
+
+// Utility function
+_Noreturn void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+    fprintf(stderr, "Usage: %s [-h] [-l] [-c core] [-b bytes] [-m group [-p port]] [-i iface] [-x name] <IP address> <port>\n", program_name);
+    fprintf(stderr, "       %s -s [-i iface] <multicast group> <port>\n", program_name);
+    fprintf(stderr, "Options:\n  -h  Display this help message\n");
+    fprintf(stderr, "  -l  Low-latency mode: busy-poll the socket instead of sleeping in select()\n");
+    fprintf(stderr, "  -c  Pin the network loop to this CPU core (implies -l)\n");
+    fprintf(stderr, "  -b  Socket receive buffer size in bytes (implies -l, default %d)\n", LOW_LATENCY_RCVBUF_BYTES);
+    fprintf(stderr, "  -m  Host: publish snapshots for spectators to this IPv4 multicast group\n");
+    fprintf(stderr, "  -p  Host: spectator port (default %d)\n", DEFAULT_SPECTATOR_PORT);
+    fprintf(stderr, "  -s  Watch a game as a spectator\n");
+    fprintf(stderr, "  -i  Local IPv4 address of the interface used for multicast\n");
+    fprintf(stderr, "  -x  Export metrics to shared memory /name and Prometheus text on " METRICS_SOCKET_FORMAT "\n", "name");
+    exit(exit_code);
+}
+
+// Function to generate random coordinates
+//void generateRandomCoordinates(int *x, int *y)
+//{
+//    *x = arc4random() % GAME_GRID_SIZE;    // Random x between 0 and 99
+//    *y = arc4random() % GAME_GRID_SIZE;    // Random y between 0 and 99
+//}
+
+// Set starting positions for both players
+void setStartingPositions(void)
+{
+    if(context.is_host)
+    {
+        context.hostx   = GAME_GRID_SIZE / 2;
+        context.hosty   = GAME_GRID_SIZE / 2;
+        context.clientx = -1;    // Unknown position
+        context.clienty = -1;
+    }
+    else
+    {
+        context.clientx = GAME_GRID_SIZE / 2;
+        context.clienty = GAME_GRID_SIZE / 2;
+        context.hostx   = -1;    // Unknown position
+        context.hosty   = -1;
+    }
+}
+
+// Clean up ncurses
+void cleanupNcurses(void)
+{
+    endwin();    // End ncurses mode
+}
+
+// Draws the dots as X's
+void drawDot(int x, int y, int color_pair)
+{
+    attron(COLOR_PAIR(color_pair));
+    mvaddch(y % LINES, x % COLS, 'X');
+    attroff(COLOR_PAIR(color_pair));
+}
+
+// Read user input
+int getUserInput(void)
+{
+    return getch();    // Non-blocking input
+}
+
+// Update local dot based on input
+void updateLocalDot(int ch)
+{
+    int *x;
+    int *y;
+    if(context.is_host)
+    {
+        x = &context.hostx;
+        y = &context.hosty;
+    }
+    else
+    {
+        x = &context.clientx;
+        y = &context.clienty;
+    }
+
+    switch(ch)
+    {
+        case KEY_UP:
+            *y = (*y - 1 + GAME_GRID_SIZE) % GAME_GRID_SIZE;
+            break;
+        case KEY_DOWN:
+            *y = (*y + 1) % GAME_GRID_SIZE;
+            break;
+        case KEY_LEFT:
+            *x = (*x - 1 + GAME_GRID_SIZE) % GAME_GRID_SIZE;
+            break;
+        case KEY_RIGHT:
+            *x = (*x + 1) % GAME_GRID_SIZE;
+            break;
+        default:
+            break;
+    }
+}
+
+// Clear the screen
+void clearScreen(void)
+{
+    clear();
+    refresh();
+}
+
+// Sends update of dot position straight away if the budget allows
+// The host only queues it for the scheduler when other updates are already waiting or the budget is spent
+void sendPositionUpdate(void)
+{
+    const char *packet;
+
+    if(context.is_host)
+    {
+        packet = createPacket(context.hostx, context.hosty, "update");
+        if(context.peer_addr_len == 0 || updatesPending() || packetWireSize(packet) > context.link.budget_bytes)
+        {
+            queueEntityUpdate(ENTITY_HOST);
+            return;
+        }
+
+        // Nothing to rank it against, so there is no reason to wait for the tick
+        sendPacketToPeer(packet, true);
+        return;
+    }
+
+    packet = createPacket(context.clientx, context.clienty, "update");
+    if(packetWireSize(packet) > context.link.budget_bytes)
+    {
+        // Over the rate: the next tick sends whatever the position is by then
+        context.link.send_pending = true;
+        return;
+    }
+
+    context.link.send_pending = false;
+    sendPacketToPeer(packet, true);
+}
+
+// Bytes a packet costs against the send budget, including headers
+size_t packetWireSize(const char *packet)
+{
+    return strlen(packet) + LINK_HEADER_MAX + UDP_OVERHEAD_BYTES;
+}
+
+// Sends a packet to the peer, if we have one, tagged with our sequence number and acks
+// Only packets that need an ack are tracked for loss and RTT; bare acks are never acked back
+void sendPacketToPeer(const char *packet, bool needs_ack)
+{
+    char        datagram[BUFFER_SIZE];
+    SentPacket *record;
+    size_t      cost;
+    ssize_t     sent;
+
+    // Only send if we have a valid peer address
+    if(context.peer_addr_len > 0)
+    {
+        if(context.link.have_remote)
         {
-            if(FD_ISSET(sockfd, &readfds))
+            uint64_t hold_us = monotonicUs() - context.link.remote_recv_us;
+
+            if(hold_us > UINT32_MAX)
             {
-                ssize_t bytes = receiveUDPMessage(sockfd, &addr, &addr_len, buffer, sizeof(buffer));
-                if(bytes > 0)
-                {
-                    if(context.is_host && context.peer_addr_len == 0)
-                    {
-                        memcpy(&context.peer_addr, &addr, addr_len);
-                        context.peer_addr_len = addr_len;
-                    }
-                    updateRemoteDot(buffer);
-                    updateScreen();
-                }
+                hold_us = UINT32_MAX;
             }
+            snprintf(datagram, sizeof(datagram), "%s|%u,%u,%" PRIu32 ",%" PRIu64, packet, context.link.local_seq, context.link.remote_seq, context.link.remote_bits, hold_us);
+        }
+        else
+        {
+            snprintf(datagram, sizeof(datagram), "%s|%u", packet, context.link.local_seq);
+        }
+
+        sent = sendto(context.socket, datagram, strlen(datagram), 0, (struct sockaddr *)&context.peer_addr, context.peer_addr_len);
+        if(sent == -1)
+        {
+            perror("Failed to send message");
+            // Handle error appropriately, possibly exit or set a flag
+        }
+        else
+        {
+            metricAdd(&context.metrics->packets_out, 1);
+            metricAdd(&context.metrics->bytes_sent, (uint64_t)sent);
+        }
 
-            if(FD_ISSET(STDIN_FILENO, &readfds))
+        if(needs_ack)
+        {
+            // A slot still in flight after a full lap of the history was never acked
+            record = &context.link.sent[context.link.local_seq % SENT_HISTORY];
+            if(record->in_flight)
             {
-                handleInput();
+                context.link.lost++;
             }
+            record->seq       = context.link.local_seq;
+            record->in_flight = true;
+            record->sent_us   = monotonicUs();
+        }
+        context.link.local_seq++;
+
+        cost                      = packetWireSize(packet);
+        context.link.budget_bytes = cost < context.link.budget_bytes ? context.link.budget_bytes - (uint32_t)cost : 0;
+
+        // Anything we send doubles as a keepalive and carries our acks
+        timerWheelSchedule(&context.timers, &context.keepalive_timer, monotonicMs(), KEEPALIVE_INTERVAL_MS);
+        timerWheelCancel(&context.ack_timer);
+    }
+}
+
+void updateScreen(void)
+{
+    uint64_t start_us = monotonicUs();
+
+    context.screen_dirty = false;
+    clear();    // Clear the screen
+
+    // Draw the grid background
+    for(int y = 0; y < GAME_GRID_SIZE; ++y)
+    {
+        for(int x = 0; x < GAME_GRID_SIZE; ++x)
+        {
+            mvaddch(y, x, '.');    // Move to position (y, x) and add a dot
+        }
+    }
+
+    if(context.spectators.watch)
+    {
+        // Spectators have no local player and draw whichever dots are known
+        if(context.hostx >= 0 && context.hosty >= 0)
+        {
+            drawDot(context.hostx, context.hosty, 1);    // Host dot
+        }
+        if(context.clientx >= 0 && context.clienty >= 0)
+        {
+            drawDot(context.clientx, context.clienty, 2);    // Client dot
+        }
+    }
+    else
+    {
+        // Draw local player's dot
+        if(context.is_host)
+        {
+            drawDot(context.hostx, context.hosty, 1);    // Host dot
+        }
+        else
+        {
+            drawDot(context.clientx, context.clienty, 2);    // Client dot
+        }
+
+        // Draw remote player's dot if known
+        if(context.is_host && context.clientx >= 0 && context.clienty >= 0)
+        {
+            drawDot(context.clientx, context.clienty, 2);    // Client dot
+        }
+        else if(!context.is_host && context.hostx >= 0 && context.hosty >= 0)
+        {
+            drawDot(context.hostx, context.hosty, 1);    // Host dot
         }
     }
 
+    refresh();    // Refresh the screen to display changes
+
+    metricSet(&context.metrics->render_time_us, monotonicUs() - start_us);
+}
+
+// Receives updates of dot position
+void receivePositionUpdate(void)
+{
+    char                    buffer[BUFFER_SIZE];
+    struct sockaddr_storage source_addr;
+    socklen_t               addr_len = sizeof(source_addr);
+
+    ssize_t bytes = receiveUDPMessage(context.socket, &source_addr, &addr_len, buffer, sizeof(buffer));
+    if(bytes > 0)
+    {
+        // receiveUDPMessage has already applied the update
+        updateScreen();
+    }
+}
+
+// Update the screen to show both local and remote dots
+void handleInput(void)
+{
+    int ch = getch();
+    if(ch != ERR)
+    {
+        updateLocalDot(ch);
+        sendPositionUpdate();
+        updateScreen();
+    }
+}
+
+// Display an error message and exit
+_Noreturn void errorMessage(const char *msg)
+{
     cleanupNcurses();
-    socket_close(sockfd);
-    printf("Exiting...\n");
-    return 0;
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(EXIT_FAILURE);
 }
@@ -1,36 +1,260 @@
 #ifndef GAME_H
 #define GAME_H
 
+// CPU affinity and the socket busy-poll options are Linux extensions
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <ncurses.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+    #include <linux/sockios.h>
+#endif
 
 #define UNKNOWN_OPTION_MESSAGE_LEN 24
 #define BUFFER_SIZE 1024
+#define SELECT_TIMEOUT_USEC 100000
+#define GAME_GRID_SIZE 20
 #define BASE_TEN 10
 #define PACKET_SIZE 256
 #define GAME_LOOP_COUNT 5
 #define DEFAULT_PORT 8080
+#define DEFAULT_SPECTATOR_PORT 8081
+#define SPECTATOR_TTL 1    // Keep snapshots on the local network
+#define SPECTATOR_REORDER_WINDOW 64    // A snapshot further behind than this starts a new stream (host restarted)
+#define SPECTATOR_STALE_MS 1000        // After this long without a snapshot, take whatever arrives
 #define DEFAULT_IP "192.168.0.1"
 
+// Time units
+#define MS_PER_SEC 1000U
+#define US_PER_SEC 1000000U
+#define US_PER_MS 1000U
+#define NS_PER_US 1000U
+
+// Timer wheel geometry: 4 levels of 64 slots at 10 ms per tick covers ~46 hours
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_TICK_MS 10
+
+// Low-latency mode
+#define BUSY_POLL_USEC 50
+#define LOW_LATENCY_NICE (-10)
+#define LOW_LATENCY_RCVBUF_BYTES 65536
+#define LOW_LATENCY_RCVBUF_MIN 4096
+#define LOW_LATENCY_RCVBUF_MAX 8388608
+
+// Update scheduling: the host sends each client the most relevant entities that fit its byte budget
+#define MAX_ENTITIES 2
+#define ENTITY_HOST 0
+#define ENTITY_CLIENT 1
+#define UDP_OVERHEAD_BYTES 28    // IPv4 + UDP headers
+#define CLIENT_BURST_BYTES 512
+#define PRIORITY_SCALE 1024
+
+// Congestion control: per-peer AIMD on the send rate, driven by loss and RTT from sequence/ack data
+#define SENT_HISTORY 64
+#define ACK_BITS 32
+#define SEQ_HALF_RANGE 0x8000U      // 16-bit sequence numbers: anything less than this ahead counts as newer
+#define SRTT_GAIN_DIVISOR 8         // Each RTT sample moves the smoothed RTT 1/8 of the way
+#define PERCENT 100U
+#define LINK_HEADER_MAX 36          // "|65535,65535,4294967295,4294967295"
+#define LOSS_REORDER_THRESHOLD 3    // Unacked packets this far behind the newest ack are lost
+#define ACK_DELAY_MS 50             // Longest we sit on an ack before sending one on its own
+#define ACK_ONLY_STATE "ack"        // game_state of a bare ack; it is never acked or answered itself
+#define LINK_REORDER_WINDOW 64      // A peer sequence number further behind than this starts a new stream (peer restarted)
+#define LINK_STALE_MS 2000          // Two missed keepalives: a sequence number behind ours after this long also starts one
+#define RATE_CONTROL_INTERVAL_MS 250
+#define RATE_INITIAL_BYTES_PER_SEC 4000
+#define RATE_FLOOR_BYTES_PER_SEC 500
+#define RATE_CEILING_BYTES_PER_SEC 8000
+#define RATE_INCREASE_BYTES_PER_SEC 250
+#define LOSS_THRESHOLD_PERCENT 5
+#define RTT_INFLATION_US 100000    // Smoothed RTT this far above the minimum means a queue is building
+
+// Metrics export
+#define METRICS_MAGIC 0x47414D45U    // "GAME"
+#define METRICS_VERSION 2
+#define METRICS_NAME_MAX 64
+#define METRICS_SOCKET_FORMAT "/tmp/%s.sock"
+#define METRICS_BACKLOG 8
+#define METRICS_TEXT_SIZE 2048
+#define METRICS_REQUEST_TIMEOUT_USEC 50000
+
+// Session timing
+#define SESSION_IDLE_TIMEOUT_MS 10000
+#define KEEPALIVE_INTERVAL_MS 1000
+#define RETRANSMIT_INTERVAL_MS 250
+#define SIM_TICK_MS 50
+
+typedef struct Timer Timer;
+typedef void (*TimerCallback)(Timer *timer, void *arg);
+
+// Intrusive timer node, embedded in whatever owns the timeout
+// A timer is pending while it is linked into a wheel slot (next != NULL)
+struct Timer
+{
+    Timer        *next;
+    Timer        *prev;
+    uint64_t      expires;    // Absolute expiry, in wheel ticks
+    TimerCallback callback;
+    void         *arg;
+};
+
+// Hierarchical timing wheel with O(1) schedule and cancel
+// Each slot is a sentinel head of a circular doubly linked list
+typedef struct
+{
+    Timer    slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t current;      // Next tick to be processed
+    uint64_t origin_ms;    // Monotonic time of tick zero
+} TimerWheel;
+
+// Opt-in busy-poll configuration and the latency/CPU figures it produces
+typedef struct
+{
+    bool          enabled;
+    int           cpu_core;        // -1 leaves the affinity alone
+    int           rcvbuf_bytes;    // Requested SO_RCVBUF
+    uint64_t      start_us;
+    struct rusage start_usage;
+    uint64_t      polls;             // recvfrom attempts
+    uint64_t      samples;           // Packets with a kernel receive timestamp
+    uint64_t      latency_sum_ns;    // Kernel receive to user space
+    uint64_t      latency_max_ns;
+} LowLatency;
+
+// Per-client send state for priority-based update scheduling
+typedef struct
+{
+    uint32_t priority[MAX_ENTITIES];    // Grows every tick an update waits, faster for nearby entities
+    bool     pending[MAX_ENTITIES];     // Changed since last sent to this client
+} ClientUpdates;
+
+typedef struct
+{
+    uint16_t seq;
+    bool     in_flight;    // Sent, not yet acked or declared lost
+    uint64_t sent_us;
+} SentPacket;
+
+// Sequence/ack bookkeeping and the AIMD-controlled send rate for the peer
+typedef struct
+{
+    uint16_t   local_seq;      // Next sequence number to send
+    uint16_t   remote_seq;     // Newest sequence number received
+    uint32_t   remote_bits;    // Bit n set: remote_seq - 1 - n was also received
+    bool       have_remote;
+    uint64_t   remote_recv_us;    // When remote_seq arrived, so the echoed hold time can be taken off the peer's RTT
+    uint16_t   latest_ack;
+    bool       have_ack;
+    SentPacket sent[SENT_HISTORY];
+    uint64_t   srtt_us;
+    uint64_t   min_rtt_us;
+    uint32_t   acked;    // Outcomes since the last rate decision
+    uint32_t   lost;
+    uint32_t   rate_bytes_per_sec;
+    uint32_t   budget_bytes;    // Unspent allowance, refilled every tick up to CLIENT_BURST_BYTES
+    bool       send_pending;    // Client position waiting for budget
+} PeerLink;
+
+// Multicast spectator feed: the host publishes snapshots once, any number of spectators join the group
+typedef struct
+{
+    bool               publish;    // Host: send snapshots to the group
+    bool               watch;      // Run as a read-only spectator
+    int                socket;
+    struct sockaddr_in group_addr;
+    struct in_addr     interface;    // Local interface for the group; INADDR_ANY lets the routing table pick
+    uint16_t           snapshot_seq;
+    bool               have_snapshot;
+    uint64_t           snapshot_ms;    // When the snapshot on screen was accepted
+} Spectators;
+
+// Layout of the shared metrics page; external readers map it and check magic/version first
+// Times are in microseconds; the Prometheus endpoint converts them to seconds
+typedef struct
+{
+    uint32_t         magic;
+    uint32_t         version;
+    _Atomic uint64_t packets_in;
+    _Atomic uint64_t packets_out;
+    _Atomic uint64_t bytes_received;
+    _Atomic uint64_t bytes_sent;
+    _Atomic uint64_t decode_errors;
+    _Atomic uint64_t sessions;
+    _Atomic uint64_t tick_duration_us;
+    _Atomic uint64_t render_time_us;
+    _Atomic uint64_t send_rate_bytes_per_sec;
+    _Atomic uint64_t srtt_us;
+    _Atomic uint64_t foreign_packets;    // Datagrams from anyone but the current peer
+} Metrics;
+
+// Everything one game process knows; main.c, game_bench.c and timer_wheel_check.c share the single instance in game.c
+typedef struct
+{
+    int                     socket;
+    int                     hostx;
+    int                     hosty;
+    int                     clientx;
+    int                     clienty;
+    bool                    is_host;
+    struct sockaddr_storage peer_addr;
+    socklen_t               peer_addr_len;
+    char                    game_state[BUFFER_SIZE];
+    TimerWheel              timers;
+    Timer                   idle_timer;          // Forgets a peer that has gone quiet
+    Timer                   keepalive_timer;     // Sends our position when we have been silent
+    Timer                   retransmit_timer;    // Client resends until the host answers
+    Timer                   tick_timer;          // Simulation tick
+    bool                    peer_confirmed;      // Heard from the peer since the last idle timeout
+    bool                    screen_dirty;        // State changed outside the input/receive paths
+    LowLatency              low_latency;
+    ClientUpdates           updates;    // Host only: what the client still needs to hear about
+    PeerLink                link;
+    Metrics                *metrics;    // Shared page when exporting, otherwise process-local
+    Timer                   ack_timer;     // Sends a bare ack when we have nothing else to say
+    Timer                   rate_timer;    // Periodic AIMD decision
+    Spectators              spectators;
+    const char             *metrics_name;    // -x: shared page "/name", socket METRICS_SOCKET_FORMAT
+    char                    metrics_socket_path[METRICS_NAME_MAX + sizeof(METRICS_SOCKET_FORMAT)];
+} Context;
+
+extern Context               context;      // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+extern volatile sig_atomic_t quit_flag;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
 // Function prototypes
 
 // Argument handling
 void      parse_arguments(int argc, char *argv[], const char **ip_address, char **port_number);
 void      handle_arguments(const char *binary_name, const char *ip_address, const char *port_str, in_port_t *port);
 in_port_t parse_in_port_t(const char *binary_name, const char *port_str);
+int       parse_int(const char *binary_name, const char *str, int min, int max);
 
 // Network setup
 int  setupConnection(const int *sockfd, struct sockaddr_storage *addr, const char *ip_address, const char *port);
@@ -44,6 +268,7 @@ void initializeNetwork(const char *ip_address, const char *port);
 void    sendUDPMessage(int sockfd, const struct sockaddr_storage *dest_addr, socklen_t addr_len, const char *message);
 ssize_t receiveUDPMessage(int sockfd, struct sockaddr_storage *source_addr, socklen_t *addr_len, char *buffer, size_t buffer_size);
 void    handleReceivedPacket(const char *packet);
+bool    sameAddress(const struct sockaddr_storage *a, const struct sockaddr_storage *b);
 
 // Game functionality
 char *createPacket(int x, int y, const char *game_state);
@@ -61,8 +286,69 @@ void           handleInput(void);
 int            getUserInput(void);
 void           updateLocalDot(int ch);
 void           sendPositionUpdate(void);
+void           sendPacketToPeer(const char *packet, bool needs_ack);
+size_t         packetWireSize(const char *packet);
 void           receivePositionUpdate(void);
 void           clearScreen(void);
 void           errorMessage(const char *msg);
 
+// Timers
+uint64_t monotonicUs(void);
+uint64_t monotonicMs(void);
+void     timerWheelInit(TimerWheel *wheel, uint64_t now_ms);
+void     timerInit(Timer *timer, TimerCallback callback, void *arg);
+bool     timerPending(const Timer *timer);
+void     timerWheelSchedule(TimerWheel *wheel, Timer *timer, uint64_t now_ms, uint64_t delay_ms);
+void     timerWheelCancel(Timer *timer);
+void     timerWheelAdvance(TimerWheel *wheel, uint64_t now_ms);
+uint64_t timerWheelNextTimeoutMs(const TimerWheel *wheel, uint64_t now_ms);
+
+// Low-latency mode
+void     enableLowLatency(int sockfd);
+void     recordWakeupLatency(int sockfd);
+void     busyPollLoop(int sockfd);
+void     reportLowLatency(void);
+
+// Update scheduling
+void resetClientUpdates(void);
+void queueEntityUpdate(int entity);
+bool updatesPending(void);
+void entityPosition(int entity, int *x, int *y);
+int  entityDistanceToClient(int entity);
+void scheduleUpdates(void);
+
+// Congestion control
+void resetPeerLink(void);
+bool seqGreater(uint16_t a, uint16_t b);
+void processLinkHeader(const char *header, bool wants_ack);
+void ackSentPacket(uint16_t seq, uint64_t now_us, bool sample_rtt, uint64_t hold_us);
+void refillSendBudget(void);
+void onAckDelay(Timer *timer, void *arg);
+void onRateControl(Timer *timer, void *arg);
+
+// Spectators
+void  parseMulticastGroup(const char *binary_name, const char *str, struct in_addr *group);
+void  setupSpectatorPublisher(void);
+void  joinSpectatorGroup(int sockfd, const char *group, const char *port);
+char *createSnapshot(uint16_t seq);
+void  publishSnapshot(void);
+void  updateSpectatorView(const char *packet);
+void  spectateLoop(int sockfd);
+
+// Metrics
+void   metricAdd(_Atomic uint64_t *metric, uint64_t amount);
+void   metricSet(_Atomic uint64_t *metric, uint64_t value);
+void   initMetrics(const char *name);
+size_t formatMetrics(char *buffer, size_t size);
+void  *metricsServer(void *arg);
+void   closeMetrics(const char *name);
+
+// Session liveness
+void startSessionTimers(void);
+void sessionActivity(void);
+void onIdleTimeout(Timer *timer, void *arg);
+void onKeepalive(Timer *timer, void *arg);
+void onRetransmit(Timer *timer, void *arg);
+void simulationTick(Timer *timer, void *arg);
+
 #endif    // GAME_H
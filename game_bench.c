@@ -0,0 +1,330 @@
+// Microbenchmarks for the packet and render hot paths
+// Built as its own target linked with game.c; the benchmarks set up the shared context directly
+#include "../include/game.h"
+
+#define BENCH_SAMPLES 1000
+#define BENCH_WARMUP_SAMPLES 100
+#define BENCH_DEFAULT_OPS_PER_SAMPLE 100
+#define BENCH_DEFAULT_TERM "xterm"
+#define PERCENTILE_50 50
+#define PERCENTILE_90 90
+#define PERCENTILE_99 99
+#define HUNDRED 100
+
+typedef void (*BenchFunction)(uint64_t iteration);
+
+typedef struct
+{
+    const char   *name;
+    BenchFunction run;
+} Benchmark;
+
+typedef struct
+{
+    const char *name;
+    uint64_t    ops;
+    double      ns_per_op;
+    double      allocs_per_op;
+    double      p50_ns;
+    double      p90_ns;
+    double      p99_ns;
+} BenchResult;
+
+static volatile uint64_t bench_sink;              // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static uint64_t          allocation_count;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static bool              counting_allocations;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+#ifdef __GLIBC__
+// Count heap allocations by interposing on malloc; glibc exports its allocator under __libc_* names
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    if(counting_allocations)
+    {
+        allocation_count++;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if(counting_allocations)
+    {
+        allocation_count++;
+    }
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if(counting_allocations)
+    {
+        allocation_count++;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+    #define ALLOCATIONS_COUNTED true
+#else
+    #define ALLOCATIONS_COUNTED false
+#endif
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+static void benchCreatePacket(uint64_t iteration)
+{
+    const char *packet = createPacket((int)(iteration % GAME_GRID_SIZE), (int)((iteration / GAME_GRID_SIZE) % GAME_GRID_SIZE), "update");
+
+    bench_sink += (uint64_t)packet[0];
+}
+
+static void benchUpdateRemoteDot(uint64_t iteration)
+{
+    (void)iteration;
+
+    updateRemoteDot("7,12|update");
+    bench_sink += (uint64_t)context.hostx;
+}
+
+// Same as above but with the sequence/ack trailer every real packet now carries
+static void benchUpdateRemoteDotWithAcks(uint64_t iteration)
+{
+    (void)iteration;
+
+    updateRemoteDot("7,12|update|42,17,4294967295");
+    bench_sink += (uint64_t)context.hostx;
+}
+
+static void benchUpdateLocalDot(uint64_t iteration)
+{
+    static const int keys[] = {KEY_UP, KEY_RIGHT, KEY_DOWN, KEY_LEFT};
+
+    updateLocalDot(keys[iteration % (sizeof(keys) / sizeof(keys[0]))]);
+    bench_sink += (uint64_t)context.clientx;
+}
+
+// Moves the remote dot every frame so refresh() has real output to produce
+static void benchUpdateScreen(uint64_t iteration)
+{
+    context.hostx = (int)(iteration % GAME_GRID_SIZE);
+    updateScreen();
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double lhs = *(const double *)a;
+    double rhs = *(const double *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// Runs one benchmark as BENCH_SAMPLES timed batches; percentiles are over the per-batch ns/op
+static BenchResult runBenchmark(const Benchmark *benchmark, uint64_t ops_per_sample)
+{
+    static double samples[BENCH_SAMPLES];
+    BenchResult   result;
+    uint64_t      iteration = 0;
+    uint64_t      total_ns  = 0;
+
+    for(int sample = 0; sample < BENCH_WARMUP_SAMPLES; ++sample)
+    {
+        for(uint64_t op = 0; op < ops_per_sample; ++op)
+        {
+            benchmark->run(iteration++);
+        }
+    }
+
+    allocation_count     = 0;
+    counting_allocations = true;
+    for(int sample = 0; sample < BENCH_SAMPLES; ++sample)
+    {
+        uint64_t start = nowNs();
+        uint64_t elapsed;
+
+        for(uint64_t op = 0; op < ops_per_sample; ++op)
+        {
+            benchmark->run(iteration++);
+        }
+
+        elapsed         = nowNs() - start;
+        total_ns       += elapsed;
+        samples[sample] = (double)elapsed / (double)ops_per_sample;
+    }
+    counting_allocations = false;
+
+    qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), compareDoubles);
+
+    result.name          = benchmark->name;
+    result.ops           = ops_per_sample * BENCH_SAMPLES;
+    result.ns_per_op     = (double)total_ns / (double)result.ops;
+    result.allocs_per_op = ALLOCATIONS_COUNTED ? (double)allocation_count / (double)result.ops : -1.0;
+    result.p50_ns        = samples[BENCH_SAMPLES * PERCENTILE_50 / HUNDRED];
+    result.p90_ns        = samples[BENCH_SAMPLES * PERCENTILE_90 / HUNDRED];
+    result.p99_ns        = samples[BENCH_SAMPLES * PERCENTILE_99 / HUNDRED];
+
+    return result;
+}
+
+// One JSON object per line so runs can be diffed or loaded by a script
+static void writeResultJson(FILE *out, const BenchResult *result)
+{
+    fprintf(out,
+            "{\"name\":\"%s\",\"ops\":%" PRIu64 ",\"ns_per_op\":%.2f,\"allocs_per_op\":%.4f,\"p50_ns\":%.2f,\"p90_ns\":%.2f,\"p99_ns\":%.2f}\n",
+            result->name,
+            result->ops,
+            result->ns_per_op,
+            result->allocs_per_op,
+            result->p50_ns,
+            result->p90_ns,
+            result->p99_ns);
+}
+
+// Headless ncurses: render into a terminal whose output goes to /dev/null
+static SCREEN *setupHeadlessScreen(FILE **out, FILE **in)
+{
+    const char *term = getenv("TERM");
+    SCREEN     *screen;
+
+    *out = fopen("/dev/null", "we");
+    *in  = fopen("/dev/null", "re");
+    if(*out == NULL || *in == NULL)
+    {
+        perror("fopen /dev/null");
+        exit(EXIT_FAILURE);
+    }
+
+    screen = newterm(term != NULL && *term != '\0' ? term : BENCH_DEFAULT_TERM, *out, *in);
+    if(screen == NULL)
+    {
+        screen = newterm(BENCH_DEFAULT_TERM, *out, *in);
+    }
+    if(screen == NULL)
+    {
+        fprintf(stderr, "newterm failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    set_term(screen);
+    if(has_colors())
+    {
+        start_color();
+        init_pair(1, COLOR_RED, COLOR_BLACK);     // Host color
+        init_pair(2, COLOR_BLUE, COLOR_BLACK);    // Client color
+    }
+
+    return screen;
+}
+
+static _Noreturn void benchUsage(const char *program_name, int exit_code)
+{
+    fprintf(stderr, "Usage: %s [-h] [-n ops per sample] [-o results.jsonl]\n", program_name);
+    fprintf(stderr, "Options:\n  -h  Display this help message\n");
+    fprintf(stderr, "  -n  Operations per timed sample (default %d, %d samples per benchmark)\n", BENCH_DEFAULT_OPS_PER_SAMPLE, BENCH_SAMPLES);
+    fprintf(stderr, "  -o  Also write one JSON object per benchmark to this file\n");
+    exit(exit_code);
+}
+
+// Parses -n locally so a bad value shows the benchmark's usage rather than the game's
+static uint64_t parseOpsPerSample(const char *program_name, const char *str)
+{
+    char     *endptr;
+    uintmax_t parsed_value;
+
+    errno        = 0;
+    parsed_value = strtoumax(str, &endptr, BASE_TEN);
+    if(errno != 0 || endptr == str || *endptr != '\0' || parsed_value == 0 || parsed_value > INT32_MAX)
+    {
+        fprintf(stderr, "Invalid ops per sample: %s\n", str);
+        benchUsage(program_name, EXIT_FAILURE);
+    }
+
+    return (uint64_t)parsed_value;
+}
+
+int main(int argc, char *argv[])
+{
+    static const Benchmark benchmarks[] = {
+        {"createPacket",         benchCreatePacket           },
+        {"updateRemoteDot",      benchUpdateRemoteDot        },
+        {"updateRemoteDot+acks", benchUpdateRemoteDotWithAcks},
+        {"updateLocalDot",       benchUpdateLocalDot         },
+        {"updateScreen",         benchUpdateScreen           },
+    };
+    uint64_t    ops_per_sample = BENCH_DEFAULT_OPS_PER_SAMPLE;
+    const char *json_path      = NULL;
+    FILE       *json_out       = NULL;
+    FILE       *term_out;
+    FILE       *term_in;
+    SCREEN     *screen;
+    int         opt;
+
+    while((opt = getopt(argc, argv, "hn:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+                benchUsage(argv[0], EXIT_SUCCESS);
+            case 'n':
+                ops_per_sample = parseOpsPerSample(argv[0], optarg);
+                break;
+            case 'o':
+                json_path = optarg;
+                break;
+            default:
+                benchUsage(argv[0], EXIT_FAILURE);
+        }
+    }
+
+    if(json_path != NULL)
+    {
+        json_out = fopen(json_path, "we");
+        if(json_out == NULL)
+        {
+            perror(json_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Client-side context: updateRemoteDot moves the host dot and sends nothing
+    memset(&context, 0, sizeof(Context));
+    context.socket = -1;
+    initMetrics(NULL);
+    setStartingPositions();
+    resetClientUpdates();
+    resetPeerLink();
+    startSessionTimers();
+
+    screen = setupHeadlessScreen(&term_out, &term_in);
+
+    printf("%-22s %12s %12s %12s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "p50 ns", "p90 ns", "p99 ns");
+    for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i)
+    {
+        BenchResult result = runBenchmark(&benchmarks[i], ops_per_sample);
+
+        printf("%-22s %12.2f %12.4f %12.2f %12.2f %12.2f\n", result.name, result.ns_per_op, result.allocs_per_op, result.p50_ns, result.p90_ns, result.p99_ns);
+        if(json_out != NULL)
+        {
+            writeResultJson(json_out, &result);
+        }
+    }
+
+    endwin();
+    delscreen(screen);
+    fclose(term_out);
+    fclose(term_in);
+    if(json_out != NULL)
+    {
+        fclose(json_out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "../include/game.h"
+
+// Main entry point of the program
+// Parses the command-line arguments, initializes the socket and game loop
+// Handles communication between host and client based on the mode (host or client)
+int main(int argc, char *argv[])
+{
+    struct sockaddr_storage addr;
+    socklen_t               addr_len = sizeof(addr);
+    int                     sockfd;
+    char                    buffer[BUFFER_SIZE];
+    const char             *ip_address = NULL;
+    char                   *port       = NULL;
+
+    uint32_t randomSeed = arc4random();
+    srand(randomSeed);
+
+    memset(&context, 0, sizeof(Context));
+    context.low_latency.cpu_core     = -1;
+    context.low_latency.rcvbuf_bytes = LOW_LATENCY_RCVBUF_BYTES;
+    setupNcurses();
+
+    parse_arguments(argc, argv, &ip_address, &port);
+    initMetrics(context.metrics_name);
+
+    sockfd         = socket_create(AF_INET, SOCK_DGRAM, 0);
+    context.socket = sockfd;
+
+    if(context.spectators.watch)
+    {
+        // The "IP address" is the multicast group to watch
+        joinSpectatorGroup(sockfd, ip_address, port);
+        updateScreen();
+        signal(SIGINT, handle_signal);
+        spectateLoop(sockfd);
+
+        cleanupNcurses();
+        socket_close(sockfd);
+        closeMetrics(context.metrics_name);
+        printf("Exiting...\n");
+        return 0;
+    }
+
+    setupConnection(&sockfd, &addr, ip_address, port);
+
+    if(context.spectators.publish)
+    {
+        setupSpectatorPublisher();
+    }
+
+    if(context.low_latency.enabled)
+    {
+        enableLowLatency(sockfd);
+    }
+
+    setStartingPositions();
+    resetClientUpdates();
+    resetPeerLink();
+    startSessionTimers();
+    sendPositionUpdate();
+    updateScreen();
+
+    signal(SIGINT, handle_signal);
+
+    // busyPollLoop only returns once quit_flag is set, skipping the select() loop
+    if(context.low_latency.enabled)
+    {
+        busyPollLoop(sockfd);
+    }
+
+    while(!quit_flag)
+    {
+        int            activity;
+        int            max_fd;
+        fd_set         readfds;
+        struct timeval tv;
+        uint64_t       timeout_usec;
+
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+        FD_SET(STDIN_FILENO, &readfds);
+
+        // Sleep no longer than the next timer deadline
+        timeout_usec = timerWheelNextTimeoutMs(&context.timers, monotonicMs()) * US_PER_MS;
+        if(timeout_usec > SELECT_TIMEOUT_USEC)
+        {
+            timeout_usec = SELECT_TIMEOUT_USEC;
+        }
+
+        tv.tv_sec  = 0;
+        tv.tv_usec = (suseconds_t)timeout_usec;
+
+        max_fd   = sockfd > STDIN_FILENO ? sockfd : STDIN_FILENO;
+        activity = select(max_fd + 1, &readfds, NULL, NULL, &tv);
+
+        if(activity > 0)
+        {
+            if(FD_ISSET(sockfd, &readfds))
+            {
+                ssize_t bytes = receiveUDPMessage(sockfd, &addr, &addr_len, buffer, sizeof(buffer));
+                if(bytes > 0)
+                {
+                    // receiveUDPMessage has already recorded the peer and applied the update
+                    updateScreen();
+                }
+            }
+
+            if(FD_ISSET(STDIN_FILENO, &readfds))
+            {
+                handleInput();
+            }
+        }
+
+        timerWheelAdvance(&context.timers, monotonicMs());
+    }
+
+    cleanupNcurses();
+    socket_close(sockfd);
+    if(context.spectators.publish)
+    {
+        socket_close(context.spectators.socket);
+    }
+    closeMetrics(context.metrics_name);
+    if(context.low_latency.enabled)
+    {
+        reportLowLatency();
+    }
+    printf("Exiting...\n");
+    return 0;
+}
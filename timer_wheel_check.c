@@ -0,0 +1,66 @@
+// Checks that sleeping for exactly timerWheelNextTimeoutMs() never makes a timer fire late
+// Runs the wheel on a simulated clock; exits non-zero on the first late or early timer
+#include "../include/game.h"
+
+#define CHECK_TIMERS 512
+#define CHECK_MAX_DELAY_MS 300000
+#define CHECK_SEED 3980
+
+typedef struct
+{
+    Timer    timer;
+    uint64_t deadline_ms;    // Delay rounded up to a whole tick
+    uint64_t fired_ms;
+    bool     fired;
+} CheckTimer;
+
+static uint64_t simulated_now_ms;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+static void onCheckTimer(Timer *timer, void *arg)
+{
+    CheckTimer *check = (CheckTimer *)arg;
+
+    (void)timer;
+
+    check->fired    = true;
+    check->fired_ms = simulated_now_ms;
+}
+
+int main(void)
+{
+    static TimerWheel wheel;
+    static CheckTimer checks[CHECK_TIMERS];
+    int               failures = 0;
+
+    srand(CHECK_SEED);
+    timerWheelInit(&wheel, 0);
+
+    // A few delays straddling the first cascade boundary, then random ones across all levels
+    for(int i = 0; i < CHECK_TIMERS; ++i)
+    {
+        uint64_t delay_ms = i < 8 ? (uint64_t)(600 + i * 10) : (uint64_t)rand() % CHECK_MAX_DELAY_MS;
+
+        timerInit(&checks[i].timer, onCheckTimer, &checks[i]);
+        checks[i].deadline_ms = (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS * TIMER_TICK_MS;
+        timerWheelSchedule(&wheel, &checks[i].timer, 0, delay_ms);
+    }
+
+    // Sleep exactly as long as the wheel asks, with no cap
+    while(simulated_now_ms <= CHECK_MAX_DELAY_MS + TIMER_TICK_MS)
+    {
+        timerWheelAdvance(&wheel, simulated_now_ms);
+        simulated_now_ms += timerWheelNextTimeoutMs(&wheel, simulated_now_ms);
+    }
+
+    for(int i = 0; i < CHECK_TIMERS; ++i)
+    {
+        if(!checks[i].fired || checks[i].fired_ms != checks[i].deadline_ms)
+        {
+            fprintf(stderr, "timer %d: deadline %" PRIu64 " ms, fired %s at %" PRIu64 " ms\n", i, checks[i].deadline_ms, checks[i].fired ? "yes" : "no", checks[i].fired_ms);
+            ++failures;
+        }
+    }
+
+    printf("%d of %d timers fired on their deadline\n", CHECK_TIMERS - failures, CHECK_TIMERS);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}